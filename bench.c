@@ -0,0 +1,258 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MICROBENCH
+
+#include "bench_fixtures.h"
+#include "render.h"
+#include "requests.h"
+
+#define DEFAULT_MIN_TIME 0.5 // seconds each benchmark runs for at least
+
+// Every allocation in the process, json-c and curl included, goes through these.
+// glibc exports the real allocator as __libc_*, other libcs report no allocations.
+#if defined(__GLIBC__)
+#define COUNTS_ALLOCATIONS 1
+
+static atomic_llong allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static long long allocation_count(void)
+{
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+
+static long long allocation_count(void)
+{
+    return 0;
+}
+#endif
+
+struct BenchState
+{
+    struct RequestContext ctx;
+    struct Forecast forecast;
+    char payload[PAYLOAD_LEN];
+};
+
+// Runs one operation, returns number of bytes it processed or -1 on failure
+typedef int (*BenchFn)(struct BenchState *state);
+
+static int bench_parse_ip_info(struct BenchState *state)
+{
+    struct Location location;
+    if (parse_ip_info(&state->ctx, IPINFO_FIXTURE, sizeof IPINFO_FIXTURE - 1, &location) != 0)
+    {
+        return -1;
+    }
+    return (int)sizeof IPINFO_FIXTURE - 1;
+}
+
+static int bench_parse_forecast(struct BenchState *state)
+{
+    if (parse_forecast(&state->ctx, OPEN_METEO_FIXTURE, sizeof OPEN_METEO_FIXTURE - 1, 1, &state->forecast) != 0)
+    {
+        return -1;
+    }
+    return (int)sizeof OPEN_METEO_FIXTURE - 1;
+}
+
+static int bench_render_forecast(struct BenchState *state)
+{
+    return render_forecast(state->payload, sizeof state->payload, "Wednesday", &state->forecast);
+}
+
+struct Bench
+{
+    const char *name;
+    BenchFn fn;
+};
+
+static const struct Bench benches[] = {
+    {"parse_ip_info", bench_parse_ip_info},
+    {"parse_forecast", bench_parse_forecast},
+    {"render_forecast", bench_render_forecast},
+};
+
+struct BenchResult
+{
+    long long iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double ops_per_sec;
+    double mb_per_sec;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Doubles the iteration count until a batch runs for at least min_time
+static int run_bench(const struct Bench *bench, struct BenchState *state, double min_time,
+                     struct BenchResult *result)
+{
+    // warm up caches and the tokener, also catches broken fixtures early
+    if (bench->fn(state) < 0)
+    {
+        (void)fprintf(stderr, "%s: operation failed\n", bench->name);
+        return -1;
+    }
+
+    for (long long iterations = 1;; iterations *= 2)
+    {
+        long long bytes = 0;
+        long long allocations_before = allocation_count();
+        double start = now_ns();
+        for (long long i = 0; i < iterations; ++i)
+        {
+            int n = bench->fn(state);
+            // a failing operation would skew every number, don't report any
+            if (n < 0)
+            {
+                (void)fprintf(stderr, "%s: operation failed in iteration %lld\n", bench->name, i);
+                return -1;
+            }
+            bytes += n;
+        }
+        double elapsed = now_ns() - start;
+        long long allocations_after = allocation_count();
+
+        if (elapsed >= min_time * 1e9)
+        {
+            result->iterations = iterations;
+            result->ns_per_op = elapsed / (double)iterations;
+            result->allocs_per_op = (double)(allocations_after - allocations_before) / (double)iterations;
+            result->ops_per_sec = (double)iterations * 1e9 / elapsed;
+            result->mb_per_sec = (double)bytes * 1e3 / elapsed;
+            return 0;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    double min_time = DEFAULT_MIN_TIME;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            min_time = atof(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && !filter)
+        {
+            filter = argv[i];
+        }
+        else
+        {
+            (void)fprintf(stderr, "Usage: wthr_microbench [--json] [--min-time seconds] [name filter]\n");
+            return -1;
+        }
+    }
+
+    struct BenchState *state = calloc(1, sizeof *state);
+    if (!state || request_context_init(&state->ctx) != 0)
+    {
+        return -1;
+    }
+    // render benchmark needs a parsed forecast even when run alone
+    if (bench_parse_forecast(state) < 0)
+    {
+        (void)fprintf(stderr, "failed to parse forecast fixture\n");
+        return -1;
+    }
+
+    if (!json)
+    {
+        (void)printf("%-20s %12s %12s %14s %10s\n", "benchmark", "ns/op", "allocs/op", "ops/s", "MB/s");
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < sizeof benches / sizeof *benches; ++i)
+    {
+        if (filter && !strstr(benches[i].name, filter))
+        {
+            continue;
+        }
+
+        struct BenchResult result;
+        if (run_bench(&benches[i], state, min_time, &result) != 0)
+        {
+            rc = -1;
+            continue;
+        }
+
+        if (json)
+        {
+            // one object per line, easy to diff and to feed into other tools
+            (void)printf("{\"name\":\"%s\",\"iterations\":%lld,\"ns_per_op\":%.2f,\"allocs_per_op\":", benches[i].name,
+                         result.iterations, result.ns_per_op);
+            if (COUNTS_ALLOCATIONS)
+            {
+                (void)printf("%.2f", result.allocs_per_op);
+            }
+            else
+            {
+                (void)printf("null");
+            }
+            (void)printf(",\"ops_per_sec\":%.0f,\"mb_per_sec\":%.2f}\n", result.ops_per_sec, result.mb_per_sec);
+        }
+        else
+        {
+            char allocs[32] = "n/a";
+            if (COUNTS_ALLOCATIONS)
+            {
+                (void)snprintf(allocs, sizeof allocs, "%.2f", result.allocs_per_op);
+            }
+            (void)printf("%-20s %12.1f %12s %14.0f %10.2f\n", benches[i].name, result.ns_per_op, allocs,
+                         result.ops_per_sec, result.mb_per_sec);
+        }
+    }
+
+    request_context_cleanup(&state->ctx);
+    free(state);
+
+    return rc;
+}
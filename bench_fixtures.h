@@ -0,0 +1,38 @@
+#if !defined(BENCH_FIXTURES_H)
+#define BENCH_FIXTURES_H
+
+// Responses recorded from the upstream APIs, so benchmarks never touch the network
+
+// https://ipinfo.io/123.12.0.42
+static const char IPINFO_FIXTURE[] = "{ \"ip\": \"123.12.0.42\",\n"
+                                     "\"city\": \"Zhengzhou\",\n"
+                                     "\"region\": \"Henan\",\n"
+                                     "\"country\": \"CN\",\n"
+                                     "\"loc\": \"34.7578,113.6486\",\n"
+                                     "\"org\": \"AS4837 CHINA UNICOM China169 Backbone\",\n"
+                                     "\"timezone\": \"Asia/Shanghai\",\n"
+                                     "\"readme\": \"https://ipinfo.io/missingauth\"\n"
+                                     "}";
+
+// https://api.open-meteo.com/v1/forecast?latitude=34.7578&longitude=113.6486&hourly=temperature_2m,
+// relative_humidity_2m,precipitation_probability,cloud_cover,wind_speed_10m&timezone=auto&forecast_days=1
+static const char OPEN_METEO_FIXTURE[] =
+    "{\"latitude\":34.75,\"longitude\":113.625,\"generationtime_ms\":0.0520944595336914,"
+    "\"utc_offset_seconds\":28800,\"timezone\":\"Asia/Shanghai\",\"timezone_abbreviation\":\"CST\","
+    "\"elevation\":110.0,\"hourly_units\":{\"time\":\"iso8601\",\"temperature_2m\":\"\\u00b0C\","
+    "\"relative_humidity_2m\":\"%\",\"precipitation_probability\":\"%\",\"cloud_cover\":\"%\","
+    "\"wind_speed_10m\":\"km/h\"},\"hourly\":{\"time\":[\"2024-03-14T00:00\",\"2024-03-14T01:00\","
+    "\"2024-03-14T02:00\",\"2024-03-14T03:00\",\"2024-03-14T04:00\",\"2024-03-14T05:00\","
+    "\"2024-03-14T06:00\",\"2024-03-14T07:00\",\"2024-03-14T08:00\",\"2024-03-14T09:00\","
+    "\"2024-03-14T10:00\",\"2024-03-14T11:00\",\"2024-03-14T12:00\",\"2024-03-14T13:00\","
+    "\"2024-03-14T14:00\",\"2024-03-14T15:00\",\"2024-03-14T16:00\",\"2024-03-14T17:00\","
+    "\"2024-03-14T18:00\",\"2024-03-14T19:00\",\"2024-03-14T20:00\",\"2024-03-14T21:00\","
+    "\"2024-03-14T22:00\",\"2024-03-14T23:00\"],\"temperature_2m\":[2.9,1.6,1.4,0.6,1.3,1.8,2.6,4.5,"
+    "5.7,7.9,9.4,11.1,12.9,14.4,14.4,14.7,14.9,14.5,13.0,11.4,10.3,7.5,6.5,4.3],"
+    "\"relative_humidity_2m\":[87,91,94,95,94,91,87,82,76,70,63,57,52,48,45,45,45,48,52,57,63,70,"
+    "76,82],\"precipitation_probability\":[0,0,0,0,3,5,8,13,15,18,23,28,30,33,30,25,18,13,10,8,5,"
+    "3,0,0],\"cloud_cover\":[12,8,5,3,20,41,55,68,74,81,88,93,100,97,85,72,60,48,35,27,19,14,10,"
+    "6],\"wind_speed_10m\":[2.2,3.2,4.6,6.3,7.0,8.6,9.6,10.2,10.9,10.7,10.5,10.1,9.7,8.4,7.1,6.1,"
+    "4.7,3.3,2.7,1.8,1.0,1.1,1.2,2.0]}}";
+
+#endif // BENCH_FIXTURES_H
@@ -0,0 +1,808 @@
+// required for POLLRDHUP option
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "delivery.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef WTHR_IO_URING
+#include <liburing.h>
+#endif
+
+#define START_CAPACITY 5
+#define DELIVERY_TIMEOUT_MS 30000 // give up on clients that don't read for this long
+#define RING_ENTRIES 256
+
+struct Delivery
+{
+    bool uring;
+#ifdef WTHR_IO_URING
+    struct io_uring ring;
+    bool registered; // arena is registered with the ring
+#endif
+    // payloads of a broadcast live here, kept between broadcasts so it's registered only when it grows
+    char *arena;
+    size_t arena_len;
+};
+
+struct Listener
+{
+    int serv_sock;
+    int wake_fd; // eventfd written by listener_wake()
+    bool uring;
+#ifdef WTHR_IO_URING
+    struct io_uring ring;
+#endif
+    struct pollfd *pfds;
+    int pfds_size;
+    int pfds_capacity;
+};
+
+// --- poll() backend ---
+
+// Writes as much as the socket accepts without blocking, returns -1 on error
+static int send_some(int sock, const struct Payload *payload, size_t *offset)
+{
+    while (*offset < payload->len)
+    {
+        ssize_t n = send(sock, payload->data + *offset, payload->len - *offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        *offset += (size_t)n;
+    }
+    return 0;
+}
+
+static int poll_broadcast(const struct Payload *payloads, const struct Target *targets, int targets_size)
+{
+    int failed = 0;
+    // targets that didn't take the whole payload in one go
+    struct pollfd *pfds = malloc(targets_size * sizeof *pfds);
+    int *pending = malloc(targets_size * sizeof *pending);
+    size_t *offsets = calloc(targets_size, sizeof *offsets);
+    int pending_size = 0;
+
+    for (int i = 0; i < targets_size; ++i)
+    {
+        const struct Payload *payload = &payloads[targets[i].payload];
+        if (send_some(targets[i].socket, payload, &offsets[i]) == -1)
+        {
+            perror("send()");
+            ++failed;
+        }
+        else if (offsets[i] < payload->len)
+        {
+            pfds[pending_size].fd = targets[i].socket;
+            pfds[pending_size].events = POLLOUT;
+            pfds[pending_size].revents = 0;
+            pending[pending_size] = i;
+            ++pending_size;
+        }
+    }
+
+    while (pending_size > 0)
+    {
+        int poll_count = poll(pfds, pending_size, DELIVERY_TIMEOUT_MS);
+        if (poll_count == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (poll_count <= 0)
+        {
+            if (poll_count == -1)
+            {
+                perror("poll()");
+            }
+            else
+            {
+                (void)fprintf(stderr, "delivery timed out for %d clients\n", pending_size);
+            }
+            failed += pending_size;
+            break;
+        }
+
+        for (int j = 0; j < pending_size;)
+        {
+            if (pfds[j].revents == 0)
+            {
+                ++j;
+                continue;
+            }
+
+            int i = pending[j];
+            const struct Payload *payload = &payloads[targets[i].payload];
+            int rc = send_some(targets[i].socket, payload, &offsets[i]);
+            if (rc == -1)
+            {
+                perror("send()");
+                ++failed;
+            }
+            if (rc == -1 || offsets[i] == payload->len)
+            {
+                --pending_size;
+                pfds[j] = pfds[pending_size];
+                pending[j] = pending[pending_size];
+                continue;
+            }
+            pfds[j].revents = 0;
+            ++j;
+        }
+    }
+
+    free(offsets);
+    free(pending);
+    free(pfds);
+
+    return failed;
+}
+
+// --- io_uring backend ---
+
+#ifdef WTHR_IO_URING
+// user_data of the timeouts linked to sends, sends carry their target index
+#define LINK_TIMEOUT_DATA UINT64_MAX
+
+// Every send is linked to a timeout, so a client that stops reading fails on its own and
+// each pass of the loop is a single io_uring_enter(). Returns -1 if the ring stopped working,
+// requests can still be in flight then and the ring has to be torn down.
+static int uring_broadcast(struct Delivery *delivery, const struct Payload *payloads, const struct Target *targets,
+                           int targets_size, int *failed)
+{
+    struct io_uring *ring = &delivery->ring;
+    // copied by the kernel on submission
+    struct __kernel_timespec send_timeout = {.tv_sec = DELIVERY_TIMEOUT_MS / 1000};
+    // every send completes within send_timeout, waiting longer means the ring is stuck
+    struct __kernel_timespec wait_timeout = {.tv_sec = 2 * DELIVERY_TIMEOUT_MS / 1000};
+
+    size_t *offsets = calloc(targets_size, sizeof *offsets);
+    // circular queue of targets waiting for an SQE, each target is in it at most once
+    int *queue = malloc(targets_size * sizeof *queue);
+    int queue_head = 0;
+    int queued = targets_size;
+    int inflight = 0;
+    int timed_out = 0;
+    int rc = 0;
+    for (int i = 0; i < targets_size; ++i)
+    {
+        queue[i] = i;
+    }
+
+    while (queued > 0 || inflight > 0)
+    {
+        // two SQEs per send, one spare for liburing's own timeout on kernels without IORING_FEAT_EXT_ARG
+        while (queued > 0 && inflight < RING_ENTRIES / 2 && io_uring_sq_space_left(ring) > 2)
+        {
+            int i = queue[queue_head];
+            queue_head = (queue_head + 1) % targets_size;
+            --queued;
+
+            const struct Payload *payload = &payloads[targets[i].payload];
+            const char *data = payload->data + offsets[i];
+            unsigned len = (unsigned)(payload->len - offsets[i]);
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            if (delivery->registered)
+            {
+                io_uring_prep_write_fixed(sqe, targets[i].socket, data, len, 0, 0);
+            }
+            else
+            {
+                io_uring_prep_send(sqe, targets[i].socket, data, len, MSG_NOSIGNAL);
+            }
+            io_uring_sqe_set_data64(sqe, (uint64_t)i);
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_link_timeout(sqe, &send_timeout, 0);
+            io_uring_sqe_set_data64(sqe, LINK_TIMEOUT_DATA);
+            ++inflight;
+        }
+
+        struct io_uring_cqe *cqe;
+        int wait_rc = io_uring_submit_and_wait_timeout(ring, &cqe, 1, &wait_timeout, NULL);
+        if (wait_rc < 0 && wait_rc != -EINTR)
+        {
+            (void)fprintf(stderr, "io_uring_submit_and_wait_timeout(): %s\n", strerror(-wait_rc));
+            *failed += queued + inflight;
+            rc = -1;
+            break;
+        }
+
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(ring, head, cqe)
+        {
+            ++seen;
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            if (data == LINK_TIMEOUT_DATA)
+            {
+                continue;
+            }
+
+            int i = (int)data;
+            --inflight;
+            if (cqe->res == -ECANCELED)
+            {
+                // the linked timeout fired
+                ++timed_out;
+                continue;
+            }
+            if (cqe->res <= 0)
+            {
+                (void)fprintf(stderr, "send(): %s\n", cqe->res == 0 ? "connection closed" : strerror(-cqe->res));
+                ++*failed;
+                continue;
+            }
+
+            offsets[i] += (size_t)cqe->res;
+            if (offsets[i] < payloads[targets[i].payload].len)
+            {
+                queue[(queue_head + queued) % targets_size] = i;
+                ++queued;
+            }
+        }
+        io_uring_cq_advance(ring, seen);
+    }
+
+    if (timed_out > 0)
+    {
+        (void)fprintf(stderr, "delivery timed out for %d clients\n", timed_out);
+        *failed += timed_out;
+    }
+    free(queue);
+    free(offsets);
+
+    return rc;
+}
+
+// Pending requests are cancelled with the ring, the arena stays allocated until delivery_destroy()
+static void drop_ring(struct Delivery *delivery)
+{
+    io_uring_queue_exit(&delivery->ring);
+    delivery->uring = false;
+    delivery->registered = false;
+    (void)fprintf(stderr, "io_uring delivery failed, delivering with poll()\n");
+}
+#endif
+
+struct Delivery *delivery_create(void)
+{
+    struct Delivery *delivery = calloc(1, sizeof *delivery);
+    if (!delivery)
+    {
+        return NULL;
+    }
+#ifdef WTHR_IO_URING
+    int rc = io_uring_queue_init(RING_ENTRIES, &delivery->ring, 0);
+    if (rc == 0)
+    {
+        delivery->uring = true;
+    }
+    else
+    {
+        (void)fprintf(stderr, "io_uring_queue_init(): %s, delivering with poll()\n", strerror(-rc));
+    }
+#endif
+    return delivery;
+}
+
+void delivery_destroy(struct Delivery *delivery)
+{
+    if (!delivery)
+    {
+        return;
+    }
+#ifdef WTHR_IO_URING
+    if (delivery->uring)
+    {
+        io_uring_queue_exit(&delivery->ring);
+    }
+#endif
+    free(delivery->arena);
+    free(delivery);
+}
+
+char *delivery_arena(struct Delivery *delivery, size_t len)
+{
+    if (len <= delivery->arena_len)
+    {
+        return delivery->arena;
+    }
+
+    size_t arena_len = delivery->arena_len * 2 > len ? delivery->arena_len * 2 : len;
+#ifdef WTHR_IO_URING
+    // nothing is in flight between broadcasts
+    if (delivery->registered)
+    {
+        io_uring_unregister_buffers(&delivery->ring);
+        delivery->registered = false;
+    }
+#endif
+    char *arena = realloc(delivery->arena, arena_len);
+    if (!arena)
+    {
+        perror("realloc()");
+        return NULL;
+    }
+    delivery->arena = arena;
+    delivery->arena_len = arena_len;
+
+#ifdef WTHR_IO_URING
+    if (delivery->uring)
+    {
+        // one registered buffer covers every payload so the kernel doesn't pin pages per send
+        struct iovec iov = {.iov_base = delivery->arena, .iov_len = delivery->arena_len};
+        delivery->registered = io_uring_register_buffers(&delivery->ring, &iov, 1) == 0;
+    }
+#endif
+    return delivery->arena;
+}
+
+int delivery_broadcast(struct Delivery *delivery, const struct Payload *payloads, const struct Target *targets,
+                       int targets_size)
+{
+    if (targets_size == 0)
+    {
+        return 0;
+    }
+#ifdef WTHR_IO_URING
+    if (delivery->uring)
+    {
+        int failed = 0;
+        if (uring_broadcast(delivery, payloads, targets, targets_size, &failed) != 0)
+        {
+            // stale completions would otherwise be read by the next broadcast
+            drop_ring(delivery);
+        }
+        return failed;
+    }
+#else
+    (void)delivery;
+#endif
+    return poll_broadcast(payloads, targets, targets_size);
+}
+
+// --- listener ---
+
+// Resets the eventfd so the next listener_wake() is reported again
+static void drain_wakeups(struct Listener *listener)
+{
+    uint64_t count;
+    while (read(listener->wake_fd, &count, sizeof count) == -1 && errno == EINTR)
+    {
+    }
+}
+
+static void add_fd_to_pfds(int fd, short events, struct pollfd **pfds, int *pfds_size, int *pfds_capacity)
+{
+    if (*pfds_size == *pfds_capacity)
+    {
+        *pfds_capacity *= 2;
+        *pfds = realloc(*pfds, *pfds_capacity * sizeof **pfds);
+    }
+
+    (*pfds)[*pfds_size].fd = fd;
+    (*pfds)[*pfds_size].events = events;
+    (*pfds)[*pfds_size].revents = 0;
+
+    ++(*pfds_size);
+}
+
+static bool remove_fd_from_pfds(int fd, struct pollfd *pfds, int *pfds_size)
+{
+    for (int i = 0; i < *pfds_size; ++i)
+    {
+        if (pfds[i].fd == fd)
+        {
+            pfds[i] = pfds[*pfds_size - 1];
+            --(*pfds_size);
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef WTHR_IO_URING
+// user_data of listener SQEs: fd in the upper bits, kind of request in the lower two
+#define TAG_ACCEPT 0
+#define TAG_POLL 1
+#define TAG_REMOVE 2
+#define TAG_BACKOFF 3 // timer after a failed request, re-arms whatever fd is watched for
+#define TAG_BITS 2
+#define TAG_MASK ((1U << TAG_BITS) - 1)
+#define REARM_BACKOFF_MS 100
+
+static uint64_t make_tag(int fd, unsigned kind)
+{
+    return ((uint64_t)fd << TAG_BITS) | kind;
+}
+
+static struct io_uring_sqe *get_sqe(struct Listener *listener)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&listener->ring);
+    if (!sqe)
+    {
+        io_uring_submit(&listener->ring);
+        sqe = io_uring_get_sqe(&listener->ring);
+    }
+    return sqe;
+}
+
+static void arm_accept(struct Listener *listener)
+{
+    struct io_uring_sqe *sqe = get_sqe(listener);
+    io_uring_prep_multishot_accept(sqe, listener->serv_sock, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, make_tag(listener->serv_sock, TAG_ACCEPT));
+}
+
+static void arm_poll(struct Listener *listener, int fd, short events)
+{
+    struct io_uring_sqe *sqe = get_sqe(listener);
+    io_uring_prep_poll_multishot(sqe, fd, events);
+    io_uring_sqe_set_data64(sqe, make_tag(fd, TAG_POLL));
+}
+
+static int find_pfd(const struct Listener *listener, int fd)
+{
+    for (int i = 0; i < listener->pfds_size; ++i)
+    {
+        if (listener->pfds[i].fd == fd)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void arm(struct Listener *listener, int fd)
+{
+    if (fd == listener->serv_sock)
+    {
+        arm_accept(listener);
+        return;
+    }
+    // fds unwatched in the meantime stay disarmed
+    int pfd = find_pfd(listener, fd);
+    if (pfd != -1)
+    {
+        arm_poll(listener, fd, listener->pfds[pfd].events);
+    }
+}
+
+// A multishot poll can complete more than once before it's removed, e.g. for FIN and then RST
+static bool is_new_hangup(const struct Listener *listener, const struct ListenerEvent *events, int count, int fd)
+{
+    if (find_pfd(listener, fd) == -1)
+    {
+        return false;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        if (events[i].type == LISTENER_HANGUP && events[i].fd == fd)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Re-arms fd after a delay, so a persistent error doesn't turn into a busy loop
+static void arm_backoff(struct Listener *listener, int fd)
+{
+    // the kernel copies the timeout when the SQE is submitted, so it must outlive this call
+    static struct __kernel_timespec backoff = {.tv_nsec = REARM_BACKOFF_MS * 1000000L};
+
+    struct io_uring_sqe *sqe = get_sqe(listener);
+    io_uring_prep_timeout(sqe, &backoff, 0, 0);
+    io_uring_sqe_set_data64(sqe, make_tag(fd, TAG_BACKOFF));
+}
+
+// Kernels before 5.19 create the ring fine but reject multishot accept and poll
+static bool is_unsupported(int res)
+{
+    return res == -EINVAL || res == -EOPNOTSUPP;
+}
+
+// pfds mirror every watched fd, so only the ring has to go
+static void switch_to_poll(struct Listener *listener)
+{
+    struct io_uring_cqe *cqe;
+    // clients accepted in the same batch can't be reported anymore
+    while (io_uring_peek_cqe(&listener->ring, &cqe) == 0)
+    {
+        if ((io_uring_cqe_get_data64(cqe) & TAG_MASK) == TAG_ACCEPT && cqe->res >= 0)
+        {
+            close(cqe->res);
+        }
+        io_uring_cqe_seen(&listener->ring, cqe);
+    }
+    io_uring_queue_exit(&listener->ring);
+    listener->uring = false;
+    (void)fprintf(stderr, "multishot accept/poll not supported by the kernel, listening with poll()\n");
+}
+
+static int uring_wait(struct Listener *listener, struct ListenerEvent *events, int max_events)
+{
+    int count = 0;
+    bool unsupported = false;
+    struct io_uring_cqe *cqe;
+
+    int rc = io_uring_submit_and_wait(&listener->ring, 1);
+    if (rc < 0 && rc != -EINTR)
+    {
+        (void)fprintf(stderr, "io_uring_submit_and_wait(): %s\n", strerror(-rc));
+        return -1;
+    }
+
+    while (!unsupported && count < max_events && io_uring_peek_cqe(&listener->ring, &cqe) == 0)
+    {
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        int fd = (int)(data >> TAG_BITS);
+        int res = cqe->res;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        io_uring_cqe_seen(&listener->ring, cqe);
+
+        switch (data & TAG_MASK)
+        {
+        case TAG_ACCEPT:
+            if (res >= 0)
+            {
+                events[count].type = LISTENER_ACCEPT;
+                events[count].fd = res;
+                ++count;
+                if (!more)
+                {
+                    arm_accept(listener);
+                }
+            }
+            else if (is_unsupported(res))
+            {
+                unsupported = true;
+            }
+            else
+            {
+                (void)fprintf(stderr, "accept(): %s\n", strerror(-res));
+                if (!more)
+                {
+                    arm_backoff(listener, fd);
+                }
+            }
+            break;
+        case TAG_POLL:
+            if (res >= 0 && fd == listener->wake_fd)
+            {
+                drain_wakeups(listener);
+                events[count].type = LISTENER_WAKEUP;
+                events[count].fd = fd;
+                ++count;
+                if (!more)
+                {
+                    arm(listener, fd);
+                }
+            }
+            else if (res >= 0 && res & (POLLRDHUP | POLLHUP | POLLERR))
+            {
+                if (is_new_hangup(listener, events, count, fd))
+                {
+                    events[count].type = LISTENER_HANGUP;
+                    events[count].fd = fd;
+                    ++count;
+                }
+            }
+            else if (is_unsupported(res))
+            {
+                unsupported = true;
+            }
+            else if (!more && res >= 0)
+            {
+                arm(listener, fd);
+            }
+            else if (!more && res != -ECANCELED)
+            {
+                (void)fprintf(stderr, "poll(): %s\n", strerror(-res));
+                arm_backoff(listener, fd);
+            }
+            break;
+        case TAG_BACKOFF:
+            arm(listener, fd);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (unsupported)
+    {
+        switch_to_poll(listener);
+    }
+
+    return count;
+}
+#endif
+
+static int poll_wait(struct Listener *listener, struct ListenerEvent *events, int max_events)
+{
+    int count = 0;
+
+    int poll_count = poll(listener->pfds, listener->pfds_size, -1);
+    if (poll_count == -1)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        perror("poll()");
+        return -1;
+    }
+
+    for (int i = 0; i < listener->pfds_size && count < max_events; ++i)
+    {
+        // new socket coming in
+        if (listener->pfds[i].fd == listener->serv_sock)
+        {
+            if (!(listener->pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            int client_sock = accept(listener->serv_sock, NULL, NULL);
+            if (client_sock == -1)
+            {
+                perror("accept()");
+                continue;
+            }
+            events[count].type = LISTENER_ACCEPT;
+            events[count].fd = client_sock;
+            ++count;
+        }
+        else if (listener->pfds[i].fd == listener->wake_fd)
+        {
+            if (!(listener->pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            drain_wakeups(listener);
+            events[count].type = LISTENER_WAKEUP;
+            events[count].fd = listener->wake_fd;
+            ++count;
+        }
+        // socket hangup
+        else if (listener->pfds[i].revents & (POLLRDHUP | POLLHUP | POLLERR))
+        {
+            events[count].type = LISTENER_HANGUP;
+            events[count].fd = listener->pfds[i].fd;
+            ++count;
+        }
+        listener->pfds[i].revents = 0;
+    }
+
+    return count;
+}
+
+struct Listener *listener_create(int serv_sock)
+{
+    struct Listener *listener = calloc(1, sizeof *listener);
+    if (!listener)
+    {
+        return NULL;
+    }
+    listener->serv_sock = serv_sock;
+    listener->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listener->wake_fd == -1)
+    {
+        perror("eventfd()");
+        free(listener);
+        return NULL;
+    }
+
+    // kept up to date with either backend, the poll() one can take over at any time
+    listener->pfds_capacity = START_CAPACITY;
+    listener->pfds = malloc(listener->pfds_capacity * sizeof *listener->pfds);
+    add_fd_to_pfds(serv_sock, POLLIN, &listener->pfds, &listener->pfds_size, &listener->pfds_capacity);
+    add_fd_to_pfds(listener->wake_fd, POLLIN, &listener->pfds, &listener->pfds_size, &listener->pfds_capacity);
+
+#ifdef WTHR_IO_URING
+    int rc = io_uring_queue_init(RING_ENTRIES, &listener->ring, 0);
+    if (rc == 0)
+    {
+        listener->uring = true;
+        arm_accept(listener);
+        arm_poll(listener, listener->wake_fd, POLLIN);
+    }
+    else
+    {
+        (void)fprintf(stderr, "io_uring_queue_init(): %s, listening with poll()\n", strerror(-rc));
+    }
+#endif
+
+    return listener;
+}
+
+void listener_destroy(struct Listener *listener)
+{
+    if (!listener)
+    {
+        return;
+    }
+#ifdef WTHR_IO_URING
+    if (listener->uring)
+    {
+        io_uring_queue_exit(&listener->ring);
+    }
+#endif
+    close(listener->wake_fd);
+    free(listener->pfds);
+    free(listener);
+}
+
+int listener_watch(struct Listener *listener, int fd)
+{
+    add_fd_to_pfds(fd, POLLRDHUP, &listener->pfds, &listener->pfds_size, &listener->pfds_capacity);
+#ifdef WTHR_IO_URING
+    if (listener->uring)
+    {
+        arm_poll(listener, fd, POLLRDHUP);
+    }
+#endif
+    return 0;
+}
+
+void listener_unwatch(struct Listener *listener, int fd)
+{
+    if (!remove_fd_from_pfds(fd, listener->pfds, &listener->pfds_size))
+    {
+        return;
+    }
+#ifdef WTHR_IO_URING
+    if (listener->uring)
+    {
+        struct io_uring_sqe *sqe = get_sqe(listener);
+        io_uring_prep_poll_remove(sqe, make_tag(fd, TAG_POLL));
+        io_uring_sqe_set_data64(sqe, make_tag(fd, TAG_REMOVE));
+        // submit now, the fd number may be reused by the next accept
+        io_uring_submit(&listener->ring);
+    }
+#endif
+}
+
+int listener_wake(struct Listener *listener)
+{
+    uint64_t one = 1;
+    if (write(listener->wake_fd, &one, sizeof one) == -1 && errno != EAGAIN)
+    {
+        perror("eventfd write()");
+        return -1;
+    }
+    return 0;
+}
+
+int listener_wait(struct Listener *listener, struct ListenerEvent *events, int max_events)
+{
+#ifdef WTHR_IO_URING
+    if (listener->uring)
+    {
+        return uring_wait(listener, events, max_events);
+    }
+#endif
+    return poll_wait(listener, events, max_events);
+}
@@ -0,0 +1,57 @@
+#if !defined(DELIVERY_H)
+#define DELIVERY_H
+
+#include <stddef.h>
+
+// Rendered forecast shared by every client at the same location
+struct Payload
+{
+    const char *data;
+    size_t len;
+};
+
+// Client socket and index of the payload it has to receive
+struct Target
+{
+    int socket;
+    int payload;
+};
+
+enum ListenerEventType
+{
+    LISTENER_ACCEPT, // fd is a freshly accepted client socket
+    LISTENER_HANGUP, // fd is a watched client that closed the connection
+    LISTENER_WAKEUP, // listener_wake() was called, fd is unused
+};
+
+struct ListenerEvent
+{
+    enum ListenerEventType type;
+    int fd;
+};
+
+struct Delivery;
+struct Listener;
+
+// With WTHR_IO_URING both fall back to poll() if the ring can't be set up.
+// Writes to registered buffers can't pass MSG_NOSIGNAL, so SIGPIPE must be ignored
+// by the process before delivery_broadcast() is called.
+struct Delivery *delivery_create(void);
+void delivery_destroy(struct Delivery *delivery);
+// Buffer of at least len bytes owned by delivery, payloads must point into it.
+// Valid until the next call, returns NULL if it can't grow.
+char *delivery_arena(struct Delivery *delivery, size_t len);
+// Sends payloads to all targets, returns number of targets that failed
+int delivery_broadcast(struct Delivery *delivery, const struct Payload *payloads, const struct Target *targets,
+                       int targets_size);
+
+struct Listener *listener_create(int serv_sock);
+void listener_destroy(struct Listener *listener);
+int listener_watch(struct Listener *listener, int fd);
+void listener_unwatch(struct Listener *listener, int fd);
+// Makes a blocked listener_wait() return, safe to call from any thread
+int listener_wake(struct Listener *listener);
+// Blocks until at least one event is available, returns number of events or -1
+int listener_wait(struct Listener *listener, struct ListenerEvent *events, int max_events);
+
+#endif // DELIVERY_H
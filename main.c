@@ -1,13 +1,10 @@
-// required for POLLRDHUP option
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <poll.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -18,13 +15,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "delivery.h"
+#include "render.h"
 #include "requests.h"
 
 #define BACKLOG 10
 #define START_CAPACITY 5
 #define SEND_INTERVAL 86400 // (60 * 60 * 24) seconds
-#define HOURS 24
-#define BUFFER_LEN 200
+#define MAX_EVENTS 64
 
 void *get_in_addr(struct sockaddr *sa)
 {
@@ -79,44 +77,15 @@ int get_server_socket(struct addrinfo *availables)
     return serv_sock;
 }
 
-void add_client_to_pfds(int fd, struct pollfd **pfds, int *pfds_size, int *pfds_capacity)
-{
-    if (*pfds_size == *pfds_capacity)
-    {
-        *pfds_capacity *= 2;
-        *pfds = realloc(*pfds, *pfds_capacity * sizeof **pfds);
-    }
-
-    (*pfds)[*pfds_size].fd = fd;
-    (*pfds)[*pfds_size].events = POLLRDHUP;
-    (*pfds)[*pfds_size].revents = 0;
-
-    ++(*pfds_size);
-}
-
-void remove_fd_from_pfds(int fd, struct pollfd *pfds, int *pfds_size)
-{
-    for (int i = 0; i < *pfds_size; ++i)
-    {
-        if (pfds[i].fd == fd)
-        {
-            pfds[i] = pfds[*pfds_size - 1];
-            break;
-        }
-    }
-    --(*pfds_size);
-}
-
 struct Conn
 {
     int socket;
     char ip[INET6_ADDRSTRLEN];
-    double latitude;
-    double longitude;
+    struct Location location;
 };
 
-void add_conn_to_conns(int fd, char *ip, struct Conn **conns, int *conns_size, int *conns_capacity, double latitude,
-                       double longitude)
+void add_conn_to_conns(int fd, char *ip, struct Conn **conns, int *conns_size, int *conns_capacity,
+                       struct Location location)
 {
     if (*conns_size == *conns_capacity)
     {
@@ -126,8 +95,7 @@ void add_conn_to_conns(int fd, char *ip, struct Conn **conns, int *conns_size, i
 
     (*conns)[*conns_size].socket = fd;
     strcpy((*conns)[*conns_size].ip, ip);
-    (*conns)[*conns_size].latitude = latitude;
-    (*conns)[*conns_size].longitude = longitude;
+    (*conns)[*conns_size].location = location;
     ++(*conns_size);
 }
 
@@ -138,152 +106,324 @@ void remove_conn_from_conns(int fd, struct Conn *conns, int *conns_size)
         if (conns[i].socket == fd)
         {
             conns[i] = conns[*conns_size - 1];
+            --(*conns_size);
             break;
         }
     }
-    --(*conns_size);
 }
 
-int sendall(int s, const char *buf, int *len)
+int find_conn(int fd, const struct Conn *conns, int conns_size)
 {
-    int total = 0;
-    int bytesleft = *len;
-    int n = -1;
-
-    while (total < *len)
+    for (int i = 0; i < conns_size; ++i)
     {
-        n = (int)send(s, buf + total, bytesleft, 0);
-        if (n == -1)
+        if (conns[i].socket == fd)
         {
-            break;
+            return i;
         }
-        total += n;
-        bytesleft -= n;
     }
-    *len = total;
+    return -1;
+}
 
-    return n == -1 ? -1 : 0;
+// Copy of the subscriber list the sender broadcasts to, it may reorder it
+struct ConnSnapshot
+{
+    int size;
+    struct Conn conns[];
+};
+
+// Single writer (event loop), single reader (sender thread). The writer copies its list
+// only when the sender asks for it and lends the copy until the sender hands it back.
+// Sockets that hang up in the meantime are closed after that, so their numbers can't
+// be reused by a new client while the sender still writes to them.
+struct Subscribers
+{
+    atomic_bool wanted;   // set by the sender before it waits on ready
+    atomic_bool returned; // set by the sender once it is done with lent
+    sem_t ready;          // posted by the writer after it set lent
+    struct ConnSnapshot *lent;
+    // owned by the writer
+    int *closing;
+    int closing_size;
+    int closing_capacity;
+};
+
+int init_subscribers(struct Subscribers *subscribers)
+{
+    memset(subscribers, 0, sizeof *subscribers);
+    if (sem_init(&subscribers->ready, 0, 0) == -1)
+    {
+        perror("sem_init()");
+        return -1;
+    }
+    subscribers->closing_capacity = START_CAPACITY;
+    subscribers->closing = malloc(subscribers->closing_capacity * sizeof *subscribers->closing);
+    return 0;
 }
 
-const char *precipitation_formated(int probability)
+// Sender side, blocks until the writer published, returns NULL if it couldn't
+struct ConnSnapshot *acquire_snapshot(struct Subscribers *subscribers, struct Listener *listener)
 {
-    if (probability <= 10)
+    atomic_store(&subscribers->wanted, true);
+    listener_wake(listener);
+    while (sem_wait(&subscribers->ready) == -1 && errno == EINTR)
     {
-        return "No precipitation";
     }
-    if (probability <= 35)
+    return subscribers->lent;
+}
+
+void release_snapshot(struct Subscribers *subscribers, struct Listener *listener)
+{
+    atomic_store(&subscribers->returned, true);
+    listener_wake(listener);
+}
+
+// Writer side, closes the socket now or once the lent snapshot comes back
+void close_subscriber(struct Subscribers *subscribers, int fd)
+{
+    if (!subscribers->lent)
     {
-        return "Might be snow or rain";
+        close(fd);
+        return;
     }
-    if (probability <= 80)
+    if (subscribers->closing_size == subscribers->closing_capacity)
     {
-        return "Likely will be snow or rain";
+        subscribers->closing_capacity *= 2;
+        subscribers->closing =
+            realloc(subscribers->closing, subscribers->closing_capacity * sizeof *subscribers->closing);
     }
-    if (probability <= 100)
+    subscribers->closing[subscribers->closing_size++] = fd;
+}
+
+void reclaim_snapshots(struct Subscribers *subscribers)
+{
+    if (!subscribers->lent || !atomic_exchange(&subscribers->returned, false))
     {
-        return "Very likely will be snow or rain";
+        return;
     }
-    return "Invalid precipitation probability value";
+    free(subscribers->lent);
+    subscribers->lent = NULL;
+    for (int i = 0; i < subscribers->closing_size; ++i)
+    {
+        close(subscribers->closing[i]);
+    }
+    subscribers->closing_size = 0;
 }
 
-const char *cloudy_formated(int coverage)
+int publish_snapshot(struct Subscribers *subscribers, const struct Conn *conns, int conns_size)
 {
-    if (coverage <= 20)
+    if (!atomic_exchange(&subscribers->wanted, false))
     {
-        return "Clear sky";
+        return 0;
     }
-    if (coverage <= 60)
+    // the sender returns its last snapshot before it asks again,
+    // only after seeing wanted is that guaranteed to be visible here
+    reclaim_snapshots(subscribers);
+
+    int rc = 0;
+    struct ConnSnapshot *snapshot = malloc(sizeof *snapshot + conns_size * sizeof *conns);
+    if (snapshot)
     {
-        return "Partly cloudy";
+        snapshot->size = conns_size;
+        memcpy(snapshot->conns, conns, conns_size * sizeof *conns);
+        subscribers->lent = snapshot;
     }
-    if (coverage <= 100)
+    else
     {
-        return "Cloudy";
+        perror("malloc()");
+        rc = -1;
     }
-    return "Invalid cloudy coverage value";
+    // wake the sender either way, it skips this broadcast without a snapshot
+    sem_post(&subscribers->ready);
+
+    return rc;
 }
 
-int send_forecast(int sock, double latitude, double longitude)
+void free_subscribers(struct Subscribers *subscribers)
 {
-    CURL *curl = curl_easy_init();
-    if (!curl)
+    free(subscribers->lent);
+    subscribers->lent = NULL;
+    for (int i = 0; i < subscribers->closing_size; ++i)
     {
-        (void)fprintf(stderr, "curl_easy_init() failed\n");
-        goto end;
+        close(subscribers->closing[i]);
     }
+    free(subscribers->closing);
+    sem_destroy(&subscribers->ready);
+}
 
-    double temperature[HOURS];
-    int humidity[HOURS];
-    double wind_speed[HOURS];
-    int precipitation[HOURS];
-    int cloud_cover[HOURS];
-    int rc =
-        get_forecast(curl, latitude, longitude, temperature, humidity, wind_speed, precipitation, cloud_cover, HOURS);
-    if (rc != 0)
+int sendall(int s, const char *buf, int *len)
+{
+    int total = 0;
+    int bytesleft = *len;
+    int n = -1;
+
+    while (total < *len)
     {
-        goto end;
+        n = (int)send(s, buf + total, bytesleft, 0);
+        if (n == -1)
+        {
+            break;
+        }
+        total += n;
+        bytesleft -= n;
     }
+    *len = total;
 
-    time_t current_time = time(NULL);
-    struct tm *time_info = localtime(&current_time);
+    return n == -1 ? -1 : 0;
+}
 
-    static const char *day_names[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+int compare_conns_by_location(const void *lhs, const void *rhs)
+{
+    const struct Conn *a = lhs;
+    const struct Conn *b = rhs;
+    return compare_locations(&a->location, &b->location);
+}
 
-    int day_of_week = time_info->tm_wday;
-    const char *current_day = day_names[day_of_week];
+// Renders one forecast per distinct location and hands all of them to the delivery backend at once.
+// Every payload holds days consecutive days, served from the cache whenever it covers them.
+int broadcast_forecast(struct Delivery *delivery, struct RequestContext *ctx, struct ForecastCache *cache,
+                       struct Conn *conns, int conns_size, int days)
+{
+    if (conns_size == 0)
+    {
+        return 0;
+    }
 
-    char send_str[BUFFER_LEN];
-    (void)snprintf(send_str, BUFFER_LEN, "Forecast for %s:\n", current_day);
-    int len = (int)strlen(send_str);
-    if (sendall(sock, send_str, &len) < 0)
+    // clients at the same location end up next to each other and share a payload
+    qsort(conns, conns_size, sizeof *conns, compare_conns_by_location);
+
+    int locations = 1;
+    for (int i = 1; i < conns_size; ++i)
     {
-        perror("sendall()");
-        goto end;
+        if (compare_conns_by_location(&conns[i - 1], &conns[i]) != 0)
+        {
+            ++locations;
+        }
     }
 
-    for (int i = 0; i < HOURS; ++i)
+    size_t payload_len = (size_t)days * PAYLOAD_LEN;
+    // owned by delivery and reused by every broadcast
+    char *arena = delivery_arena(delivery, locations * payload_len);
+    if (!arena)
+    {
+        return -1;
+    }
+    struct Payload *payloads = malloc(locations * sizeof *payloads);
+    struct Target *targets = malloc(conns_size * sizeof *targets);
+
+    time_t current_time = time(NULL);
+    struct tm time_info;
+    localtime_r(&current_time, &time_info);
+
+    static const char *day_names[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+
+    int payloads_size = 0;
+    int targets_size = 0;
+    for (int i = 0; i < conns_size;)
     {
-        (void)snprintf(send_str, BUFFER_LEN, "%02d:00: Temperature %dC, Humididty %d%%, Wind %.1lfkm/h, %s, %s\n", i,
-                       (int)temperature[i], humidity[i], wind_speed[i], precipitation_formated(precipitation[i]),
-                       cloudy_formated(cloud_cover[i]));
-        len = (int)strlen(send_str);
-        if (sendall(sock, send_str, &len) < 0)
+        int group_end = i + 1;
+        while (group_end < conns_size && compare_conns_by_location(&conns[i], &conns[group_end]) == 0)
         {
-            perror("sendall()");
-            goto end;
+            ++group_end;
+        }
+
+        struct Forecast forecasts[MAX_FORECAST_DAYS];
+        int rc = forecast_cache_get(cache, ctx, conns[i].location, current_time, days, forecasts);
+        if (rc == 0)
+        {
+            char *buf = arena + payloads_size * payload_len;
+            size_t len = 0;
+            for (int day = 0; day < days; ++day)
+            {
+                const char *day_name = day_names[(time_info.tm_wday + day) % 7];
+                len += render_forecast(buf + len, PAYLOAD_LEN, day_name, &forecasts[day]);
+            }
+            payloads[payloads_size].data = buf;
+            payloads[payloads_size].len = len;
+            for (int j = i; j < group_end; ++j)
+            {
+                targets[targets_size].socket = conns[j].socket;
+                targets[targets_size].payload = payloads_size;
+                ++targets_size;
+            }
+            ++payloads_size;
         }
+        i = group_end;
     }
-end:
-    curl_easy_cleanup(curl);
 
-    return 0;
+    int failed = delivery_broadcast(delivery, payloads, targets, targets_size);
+    if (failed > 0)
+    {
+        (void)fprintf(stderr, "Failed to deliver forecast to %d clients\n", failed);
+    }
+
+    free(targets);
+    free(payloads);
+
+    return failed;
 }
 
 struct SenderThreadData
 {
-    pthread_mutex_t *mutex;
-    struct Conn *conns;
-    int *conns_size;
+    struct Subscribers *subscribers;
+    struct Listener *listener;
+    int days;
 };
 
+void cleanup_request_context(void *ctx)
+{
+    request_context_cleanup(ctx);
+}
+
+void cleanup_delivery(void *delivery)
+{
+    delivery_destroy(delivery);
+}
+
+void cleanup_forecast_cache(void *cache)
+{
+    forecast_cache_free(cache);
+}
+
 void *sender_thread(void *vargp)
 {
     struct SenderThreadData *data = vargp;
-    pthread_mutex_t *mutex_ptr = data->mutex;
+
+    struct RequestContext ctx;
+    if (request_context_init(&ctx) != 0)
+    {
+        return NULL;
+    }
+    struct Delivery *delivery = delivery_create();
+    if (!delivery)
+    {
+        (void)fprintf(stderr, "delivery_create() failed\n");
+        request_context_cleanup(&ctx);
+        return NULL;
+    }
+    struct ForecastCache cache;
+    forecast_cache_init(&cache, FORECAST_CACHE_TTL);
+
+    // the thread only ends by being cancelled, release everything it owns then
+    pthread_cleanup_push(cleanup_request_context, &ctx);
+    pthread_cleanup_push(cleanup_delivery, delivery);
+    pthread_cleanup_push(cleanup_forecast_cache, &cache);
+
     while (1)
     {
-        pthread_mutex_lock(mutex_ptr);
-        int conns_size = *data->conns_size;
-        pthread_mutex_unlock(mutex_ptr);
-        for (int i = 0; i < conns_size; ++i)
+        struct ConnSnapshot *snapshot = acquire_snapshot(data->subscribers, data->listener);
+        if (snapshot)
         {
-            pthread_mutex_lock(mutex_ptr);
-            int sock = data->conns[i].socket;
-            double latitude = data->conns[i].latitude;
-            double longitude = data->conns[i].longitude;
-            pthread_mutex_unlock(mutex_ptr);
-            send_forecast(sock, latitude, longitude);
+            long fetches = cache.fetches;
+            broadcast_forecast(delivery, &ctx, &cache, snapshot->conns, snapshot->size, data->days);
+            (void)printf("Broadcast to %d clients, %ld forecasts fetched\n", snapshot->size, cache.fetches - fetches);
+            release_snapshot(data->subscribers, data->listener);
         }
+        else
+        {
+            (void)fprintf(stderr, "No subscriber list, skipping broadcast\n");
+        }
+
+        forecast_cache_evict(&cache, time(NULL));
 
         // probably can be more precise but will work for now
         time_t sleep_time;
@@ -292,24 +432,44 @@ void *sender_thread(void *vargp)
 
         sleep(SEND_INTERVAL - sleep_time);
     }
+
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
     return NULL;
 }
 
 int main(int argc, char *argv[])
 {
     const char *port;
+    int days = 1;
 
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
-        (void)fprintf(stderr, "Usage: wthr port\n");
+        (void)fprintf(stderr, "Usage: wthr port [days]\n");
         return -1;
     }
     port = argv[1];
+    if (argc == 3)
+    {
+        days = atoi(argv[2]);
+        if (days < 1 || days > MAX_FORECAST_DAYS)
+        {
+            (void)fprintf(stderr, "days must be between 1 and %d\n", MAX_FORECAST_DAYS);
+            return -1;
+        }
+    }
+
+    // curl_global_init() isn't thread-safe, do it before any context gets created
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    {
+        (void)fprintf(stderr, "curl_global_init() failed\n");
+        return -1;
+    }
 
-    CURL *curl = curl_easy_init();
-    if (!curl)
+    struct RequestContext ctx;
+    if (request_context_init(&ctx) != 0)
     {
-        (void)fprintf(stderr, "curl_easy_init() failed\n");
         return -1;
     }
 
@@ -350,25 +510,32 @@ int main(int argc, char *argv[])
 
     struct sockaddr_storage client_addr = {};
     socklen_t addr_size;
-    int client_sock;
     char ip_str[INET6_ADDRSTRLEN];
 
-    int pfds_capacity = START_CAPACITY;
-    int pfds_size = 0;
-    struct pollfd *pfds = malloc(pfds_capacity * sizeof *pfds);
-    pfds[0].fd = serv_sock;
-    pfds[0].events = POLLIN;
-    ++pfds_size;
+    // writing to a client that already left must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    struct Listener *listener = listener_create(serv_sock);
+    if (!listener)
+    {
+        (void)fprintf(stderr, "listener_create() failed\n");
+        return -1;
+    }
+    struct ListenerEvent events[MAX_EVENTS];
 
     int conns_capacity = START_CAPACITY;
     int conns_size = 0;
     struct Conn *conns = malloc(conns_capacity * sizeof *conns);
 
-    pthread_mutex_t sender_mutex;
+    struct Subscribers subscribers;
+    if (init_subscribers(&subscribers) != 0)
+    {
+        return -1;
+    }
     struct SenderThreadData sender_thread_data = {
-        .mutex = &sender_mutex,
-        .conns = conns,
-        .conns_size = &conns_size,
+        .subscribers = &subscribers,
+        .listener = listener,
+        .days = days,
     };
     pthread_t sender_pthread;
     if (pthread_create(&sender_pthread, NULL, sender_thread, &sender_thread_data) != 0)
@@ -379,58 +546,66 @@ int main(int argc, char *argv[])
 
     for (;;)
     {
-        int poll_count = poll(pfds, pfds_size, -1);
-        if (poll_count == -1)
+        int events_count = listener_wait(listener, events, MAX_EVENTS);
+        if (events_count == -1)
         {
-            perror("poll()");
             goto end;
         }
-        for (int i = 0; i < pfds_size; ++i)
+        for (int i = 0; i < events_count; ++i)
         {
+            int fd = events[i].fd;
+            // sender asked for subscribers or returned them, handled after the batch
+            if (events[i].type == LISTENER_WAKEUP)
+            {
+                continue;
+            }
             // socket hangup
-            if (pfds[i].revents & POLLRDHUP)
+            if (events[i].type == LISTENER_HANGUP)
             {
-                (void)printf("Closed connection with %s\n", conns[i - 1].ip);
-
-                pthread_mutex_lock(&sender_mutex);
-                close(pfds[i].fd);
-                remove_conn_from_conns(pfds[i].fd, conns, &conns_size);
-                pthread_mutex_unlock(&sender_mutex);
+                // a repeated hangup must not close the number again, it may belong to another socket by now
+                int conn = find_conn(fd, conns, conns_size);
+                if (conn == -1)
+                {
+                    continue;
+                }
+                (void)printf("Closed connection with %s\n", conns[conn].ip);
 
-                remove_fd_from_pfds(pfds[i].fd, pfds, &pfds_size);
+                listener_unwatch(listener, fd);
+                close_subscriber(&subscribers, fd);
+                remove_conn_from_conns(fd, conns, &conns_size);
             }
             // new socket coming in
-            else if (pfds[i].fd == serv_sock && pfds[i].revents & POLLIN)
+            else
             {
                 addr_size = sizeof client_addr;
-                client_sock = accept(serv_sock, (struct sockaddr *)&client_addr, &addr_size);
-                if (client_sock == -1)
+                if (getpeername(fd, (struct sockaddr *)&client_addr, &addr_size) == -1)
                 {
-                    perror("accept()");
+                    perror("getpeername()");
+                    close(fd);
                     continue;
                 }
                 inet_ntop(client_addr.ss_family, get_in_addr((struct sockaddr *)&client_addr), ip_str, sizeof ip_str);
 
-                add_client_to_pfds(client_sock, &pfds, &pfds_size, &pfds_capacity);
-                double latitude;
-                double longitude;
-                if (get_geolocation(curl, ip_str, &latitude, &longitude) == -1)
+                struct Location location;
+                if (get_geolocation(&ctx, ip_str, &location) == -1)
                 {
                     const char *send_str = "Couldn't retreive geolocation data\n";
                     int len = (int)strlen(send_str);
-                    sendall(client_sock, send_str, &len);
+                    sendall(fd, send_str, &len);
                     (void)fprintf(stderr, "Couldn't retreive geolocation of new client\n");
-                    close(client_sock);
+                    close(fd);
                     continue;
                 }
 
                 (void)printf("Started connection with %s\n", ip_str);
 
-                pthread_mutex_lock(&sender_mutex);
-                add_conn_to_conns(client_sock, ip_str, &conns, &conns_size, &conns_capacity, latitude, longitude);
-                pthread_mutex_unlock(&sender_mutex);
+                listener_watch(listener, fd);
+                add_conn_to_conns(fd, ip_str, &conns, &conns_size, &conns_capacity, location);
             }
         }
+
+        reclaim_snapshots(&subscribers);
+        publish_snapshot(&subscribers, conns, conns_size);
     }
 end:
     // pthread_cansel wakes up thread from sleep before joining it
@@ -443,10 +618,12 @@ end:
     }
 
     free(conns);
-    free(pfds);
+    free_subscribers(&subscribers);
+    listener_destroy(listener);
 
     close(serv_sock);
-    curl_easy_cleanup(curl);
+    request_context_cleanup(&ctx);
+    curl_global_cleanup();
 
     return 0;
 }
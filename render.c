@@ -0,0 +1,55 @@
+#include "render.h"
+
+#include <stdio.h>
+
+const char *precipitation_formated(int probability)
+{
+    if (probability <= 10)
+    {
+        return "No precipitation";
+    }
+    if (probability <= 35)
+    {
+        return "Might be snow or rain";
+    }
+    if (probability <= 80)
+    {
+        return "Likely will be snow or rain";
+    }
+    if (probability <= 100)
+    {
+        return "Very likely will be snow or rain";
+    }
+    return "Invalid precipitation probability value";
+}
+
+const char *cloudy_formated(int coverage)
+{
+    if (coverage <= 20)
+    {
+        return "Clear sky";
+    }
+    if (coverage <= 60)
+    {
+        return "Partly cloudy";
+    }
+    if (coverage <= 100)
+    {
+        return "Cloudy";
+    }
+    return "Invalid cloudy coverage value";
+}
+
+int render_forecast(char *buf, int size, const char *day, const struct Forecast *forecast)
+{
+    int len = snprintf(buf, size, "Forecast for %s:\n", day);
+
+    for (int i = 0; i < HOURS && len < size; ++i)
+    {
+        len += snprintf(buf + len, size - len, "%02d:00: Temperature %dC, Humididty %d%%, Wind %.1lfkm/h, %s, %s\n", i,
+                        (int)forecast->temperature[i], forecast->humidity[i], forecast->wind_speed[i],
+                        precipitation_formated(forecast->precipitation[i]), cloudy_formated(forecast->cloud_cover[i]));
+    }
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,13 @@
+#if !defined(RENDER_H)
+#define RENDER_H
+
+#include "requests.h"
+
+#define BUFFER_LEN 200
+#define PAYLOAD_LEN ((HOURS + 1) * BUFFER_LEN) // header and one line per hour
+
+const char *precipitation_formated(int probability);
+const char *cloudy_formated(int coverage);
+// Writes the whole day into buf, returns its length
+int render_forecast(char *buf, int size, const char *day, const struct Forecast *forecast);
+#endif // RENDER_H
@@ -2,21 +2,111 @@
 
 #include <curl/curl.h>
 #include <json-c/json.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#define IPINFO_URL_LENGTH 100
-#define IPINFO_RESPONCE_LENGTH 1000
-#define OPEN_METEO_URL_LENGTH 250
-#define OPEN_METEO_RESPONCE_LENGTH 2000
+static size_t write_response_callback(char *ptr, size_t size, size_t nmeb, void *userdata)
+{
+    struct RequestContext *ctx = userdata;
+    size_t len = size * nmeb;
+
+    // keep room for the terminating zero, a short count makes curl fail the transfer
+    if (len >= sizeof ctx->response - ctx->response_len)
+    {
+        (void)fprintf(stderr, "response doesn't fit into %zu bytes\n", sizeof ctx->response);
+        return 0;
+    }
+
+    memcpy(ctx->response + ctx->response_len, ptr, len);
+    ctx->response_len += len;
+    ctx->response[ctx->response_len] = '\0';
+    return len;
+}
+
+int request_context_init(struct RequestContext *ctx)
+{
+    memset(ctx, 0, sizeof *ctx);
+
+    ctx->curl = curl_easy_init();
+    if (!ctx->curl)
+    {
+        (void)fprintf(stderr, "curl_easy_init() failed\n");
+        return -1;
+    }
+
+    ctx->tokener = json_tokener_new();
+    if (!ctx->tokener)
+    {
+        (void)fprintf(stderr, "json_tokener_new() failed\n");
+        curl_easy_cleanup(ctx->curl);
+        ctx->curl = NULL;
+        return -1;
+    }
+
+    // options are set once, requests only change the url
+    curl_easy_setopt(ctx->curl, CURLOPT_WRITEFUNCTION, write_response_callback);
+    curl_easy_setopt(ctx->curl, CURLOPT_WRITEDATA, ctx);
+
+    return 0;
+}
+
+void request_context_cleanup(struct RequestContext *ctx)
+{
+    if (ctx->tokener)
+    {
+        json_tokener_free(ctx->tokener);
+        ctx->tokener = NULL;
+    }
+    if (ctx->curl)
+    {
+        curl_easy_cleanup(ctx->curl);
+        ctx->curl = NULL;
+    }
+}
+
+// Fetches ctx->url into ctx->response
+static int perform_request(struct RequestContext *ctx)
+{
+    ctx->response_len = 0;
+    ctx->response[0] = '\0';
+
+    curl_easy_setopt(ctx->curl, CURLOPT_URL, ctx->url);
+
+    CURLcode res = curl_easy_perform(ctx->curl);
+    if (res != CURLE_OK)
+    {
+        (void)fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        return -1;
+    }
+
+    return 0;
+}
+
+static struct json_object *parse_json(struct RequestContext *ctx, const char *json_string, size_t len)
+{
+    json_tokener_reset(ctx->tokener);
+    struct json_object *jsonObj = json_tokener_parse_ex(ctx->tokener, json_string, (int)len);
 
-int parse_ip_info(const char *json_string, double *latitude, double *longitude)
+    enum json_tokener_error error = json_tokener_get_error(ctx->tokener);
+    if (error != json_tokener_success)
+    {
+        (void)fprintf(stderr, "Error parsing JSON string: %s\n", json_tokener_error_desc(error));
+        json_object_put(jsonObj);
+        return NULL;
+    }
+
+    return jsonObj;
+}
+
+int parse_ip_info(struct RequestContext *ctx, const char *json_string, size_t len, struct Location *location)
 {
-    struct json_object *jsonObj = json_tokener_parse(json_string);
+    struct json_object *jsonObj = parse_json(ctx, json_string, len);
 
     if (!jsonObj)
     {
-        (void)fprintf(stderr, "Error parsing JSON string\n");
         return -1;
     }
 
@@ -38,7 +128,12 @@ int parse_ip_info(const char *json_string, double *latitude, double *longitude)
     {
         const char *locString = json_object_get_string(locObj);
         // Split locString into latitude and longitude
-        (void)sscanf(locString, "%lf,%lf", latitude, longitude);
+        if (sscanf(locString, "%lf,%lf", &location->latitude, &location->longitude) != 2)
+        {
+            (void)fprintf(stderr, "Error: Malformed 'loc' field\n");
+            json_object_put(jsonObj);
+            return -1;
+        }
     }
     else
     {
@@ -52,127 +147,272 @@ int parse_ip_info(const char *json_string, double *latitude, double *longitude)
     return 0;
 }
 
-static size_t write_geolocation_callback(char *ptr, size_t size, size_t nmeb, void *userbuffer)
+int get_geolocation(struct RequestContext *ctx, const char *ip_address, struct Location *location)
 {
-    char *converted = userbuffer;
-    memcpy(converted, ptr, nmeb);
-    converted[nmeb] = '\0';
-    return size * nmeb;
+    (void)snprintf(ctx->url, sizeof ctx->url, "https://ipinfo.io/%s", ip_address);
+
+    if (perform_request(ctx) != 0)
+    {
+        return -1;
+    }
+
+    // Parse the response
+    int rc = parse_ip_info(ctx, ctx->response, ctx->response_len, location);
+    if (rc != 0)
+    {
+        (void)fprintf(stderr, "Failed to parse geolocation data: %s\n", ctx->response);
+        return -1;
+    }
+
+    return 0;
 }
 
-int get_geolocation(CURL *curl, const char *ip_address, double *latitude, double *longitude)
+// UTC time at which the first hour of the response begins at the forecast location
+static int parse_forecast_start(struct json_object *root, struct json_object *time_array, time_t *start)
 {
-    curl_easy_reset(curl);
+    struct tm tm = {0};
+    const char *first_hour = json_object_get_string(json_object_array_get_idx(time_array, 0));
+    if (!first_hour || sscanf(first_hour, "%d-%d-%dT%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+                              &tm.tm_min) != 5)
+    {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+
+    // hours are in local time of the location, responses without an offset are UTC
+    int utc_offset = 0;
+    struct json_object *offsetObj;
+    if (json_object_object_get_ex(root, "utc_offset_seconds", &offsetObj))
+    {
+        utc_offset = json_object_get_int(offsetObj);
+    }
 
-    CURLcode res;
-    static char responce_buffer[IPINFO_RESPONCE_LENGTH];
+    *start = timegm(&tm) - utc_offset;
+    return 0;
+}
 
-    static char url[IPINFO_URL_LENGTH];
-    (void)snprintf(url, sizeof(url), "https://ipinfo.io/%s", ip_address);
+int parse_forecast(struct RequestContext *ctx, const char *json_string, size_t len, int days,
+                   struct Forecast *forecasts)
+{
+    struct json_object *root;
+    struct json_object *hourly;
+    struct json_object *time_array;
+    struct json_object *temperature_array;
+    struct json_object *relative_humidity_array;
+    struct json_object *wind_speed_array;
+    struct json_object *precipitation_probability_array;
+    struct json_object *cloud_cover_array;
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_geolocation_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, responce_buffer);
+    root = parse_json(ctx, json_string, len);
 
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    if (json_object_get_type(root) != json_type_object)
     {
-        (void)fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        (void)fprintf(stderr, "parse_forecast(): error parsing JSON\n");
+        json_object_put(root);
+        return -1;
+    }
 
+    if (!json_object_object_get_ex(root, "hourly", &hourly) ||
+        !json_object_object_get_ex(hourly, "time", &time_array) ||
+        !json_object_object_get_ex(hourly, "temperature_2m", &temperature_array) ||
+        !json_object_object_get_ex(hourly, "relative_humidity_2m", &relative_humidity_array) ||
+        !json_object_object_get_ex(hourly, "wind_speed_10m", &wind_speed_array) ||
+        !json_object_object_get_ex(hourly, "precipitation_probability", &precipitation_probability_array) ||
+        !json_object_object_get_ex(hourly, "cloud_cover", &cloud_cover_array))
+    {
+        (void)fprintf(stderr, "parse_forecast(): missing hourly fields\n");
+        json_object_put(root);
         return -1;
     }
 
-    // Parse the response
-    int rc = parse_ip_info(responce_buffer, latitude, longitude);
-    if (rc != 0)
+    int forecast_len = (int)json_object_array_length(time_array);
+    if (forecast_len != days * HOURS)
     {
-        (void)fprintf(stderr, "Failed to parse geolocation data: %s\n", responce_buffer);
+        (void)fprintf(stderr, "parse_forecast(): array length doesn't correspond with forecast length\n");
+        json_object_put(root);
         return -1;
     }
 
+    time_t start;
+    if (parse_forecast_start(root, time_array, &start) != 0)
+    {
+        (void)fprintf(stderr, "parse_forecast(): malformed time field\n");
+        json_object_put(root);
+        return -1;
+    }
+
+    for (int day = 0; day < days; ++day)
+    {
+        struct Forecast *forecast = &forecasts[day];
+        forecast->start = start + (time_t)day * SECONDS_PER_DAY;
+        for (int i = 0; i < HOURS; ++i)
+        {
+            size_t idx = (size_t)day * HOURS + i;
+            forecast->temperature[i] = json_object_get_double(json_object_array_get_idx(temperature_array, idx));
+            forecast->humidity[i] = json_object_get_int(json_object_array_get_idx(relative_humidity_array, idx));
+            forecast->wind_speed[i] = json_object_get_double(json_object_array_get_idx(wind_speed_array, idx));
+            forecast->precipitation[i] =
+                json_object_get_int(json_object_array_get_idx(precipitation_probability_array, idx));
+            forecast->cloud_cover[i] = json_object_get_int(json_object_array_get_idx(cloud_cover_array, idx));
+        }
+    }
+
+    json_object_put(root);
     return 0;
 }
 
-static size_t write_forecast_callback(char *ptr, size_t size, size_t nmeb, void *userbuffer)
+int get_forecast(struct RequestContext *ctx, struct Location location, int days, struct Forecast *forecasts)
 {
-    char *converted = userbuffer;
-    memcpy(converted, ptr, nmeb);
-    converted[nmeb] = '\0';
-    return size * nmeb;
+    if (days < 1 || days > MAX_UPSTREAM_DAYS)
+    {
+        (void)fprintf(stderr, "get_forecast(): %d days requested, at most %d supported\n", days, MAX_UPSTREAM_DAYS);
+        return -1;
+    }
+
+    (void)snprintf(ctx->url, sizeof ctx->url,
+                   "https://api.open-meteo.com/v1/"
+                   "forecast?latitude=%lf&longitude=%lf&hourly=temperature_2m,relative_humidity_2m,precipitation_"
+                   "probability,cloud_cover,wind_speed_10m&timezone=auto&forecast_days=%d",
+                   location.latitude, location.longitude, days);
+
+    if (perform_request(ctx) != 0)
+    {
+        return -1;
+    }
+
+    return parse_forecast(ctx, ctx->response, ctx->response_len, days, forecasts);
 }
 
-int get_forecast(CURL *curl, double latitude, double longitude, double *temperature, int *humidity, double *wind_speed,
-                 int *precipitation, int *cloud_cover, int len)
+int compare_locations(const struct Location *lhs, const struct Location *rhs)
 {
-    curl_easy_reset(curl);
-
-    CURLcode res;
-    static char responce_buffer[OPEN_METEO_RESPONCE_LENGTH];
+    if (lhs->latitude != rhs->latitude)
+    {
+        return lhs->latitude < rhs->latitude ? -1 : 1;
+    }
+    if (lhs->longitude != rhs->longitude)
+    {
+        return lhs->longitude < rhs->longitude ? -1 : 1;
+    }
+    return 0;
+}
 
-    static char url[OPEN_METEO_URL_LENGTH];
-    (void)snprintf(url, sizeof(url),
-                   "https://api.open-meteo.com/v1/"
-                   "forecast?latitude=%lf&longitude=%lf&hourly=temperature_2m,relative_humidity_2m,precipitation_"
-                   "probability,cloud_cover,wind_speed_10m&timezone=auto&forecast_days=1",
-                   latitude, longitude);
+void forecast_cache_init(struct ForecastCache *cache, time_t ttl)
+{
+    memset(cache, 0, sizeof *cache);
+    cache->ttl = ttl;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_forecast_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, responce_buffer);
+void forecast_cache_free(struct ForecastCache *cache)
+{
+    free(cache->entries);
+    memset(cache, 0, sizeof *cache);
+}
 
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+// Entries are kept sorted by location, returns the index location is at or should be inserted at
+static int find_entry(const struct ForecastCache *cache, struct Location location)
+{
+    int lo = 0;
+    int hi = cache->size;
+    while (lo < hi)
     {
-        (void)fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        int mid = lo + (hi - lo) / 2;
+        if (compare_locations(&cache->entries[mid].location, &location) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
+int forecast_cache_get(struct ForecastCache *cache, struct RequestContext *ctx, struct Location location, time_t now,
+                       int days, struct Forecast *forecasts)
+{
+    if (days < 1 || days > MAX_FORECAST_DAYS)
+    {
+        (void)fprintf(stderr, "forecast_cache_get(): %d days requested, at most %d supported\n", days,
+                      MAX_FORECAST_DAYS);
         return -1;
     }
 
-    struct json_object *root;
-    struct json_object *hourly;
-    struct json_object *time_array;
-    struct json_object *temperature_array;
-    struct json_object *relative_humidity_array;
-    struct json_object *wind_speed_array;
-    struct json_object *precipitation_probability_array;
-    struct json_object *cloud_cover_array;
+    int idx = find_entry(cache, location);
+    bool found = idx < cache->size && compare_locations(&cache->entries[idx].location, &location) == 0;
 
-    root = json_tokener_parse(responce_buffer);
+    struct ForecastCacheEntry *entry = found ? &cache->entries[idx] : NULL;
+    // first cached day that should be served, negative if the cache starts after today
+    long first = entry ? (long)((now - entry->forecasts[0].start) / SECONDS_PER_DAY) : 0;
+    bool covered = entry && now >= entry->forecasts[0].start && first + days <= FORECAST_CACHE_DAYS;
+    bool fresh = covered && now < entry->expires;
 
-    if (json_object_get_type(root) == json_type_object)
+    if (!fresh)
     {
-        json_object_object_get_ex(root, "hourly", &hourly);
-        json_object_object_get_ex(hourly, "time", &time_array);
-        int forecast_len = (int)json_object_array_length(time_array);
-        if (len != forecast_len)
+        struct Forecast fetched[FORECAST_CACHE_DAYS];
+        if (get_forecast(ctx, location, FORECAST_CACHE_DAYS, fetched) != 0)
         {
-            (void)fprintf(stderr, "get_forecast(): array length doesn't correspond with forecast length\n");
-            return -1;
+            if (!covered)
+            {
+                return -1;
+            }
+            // an expired forecast is still better than none
+            memcpy(forecasts, &entry->forecasts[first], days * sizeof *forecasts);
+            return 0;
         }
+        ++cache->fetches;
 
-        json_object_object_get_ex(hourly, "temperature_2m", &temperature_array);
-        json_object_object_get_ex(hourly, "relative_humidity_2m", &relative_humidity_array);
-        json_object_object_get_ex(hourly, "wind_speed_10m", &wind_speed_array);
-        json_object_object_get_ex(hourly, "precipitation_probability", &precipitation_probability_array);
-        json_object_object_get_ex(hourly, "cloud_cover", &cloud_cover_array);
-
-        for (int i = 0; i < len; ++i)
+        if (!found)
         {
-
-            temperature[i] = json_object_get_double(json_object_array_get_idx(temperature_array, i));
-            humidity[i] = json_object_get_int(json_object_array_get_idx(relative_humidity_array, i));
-            wind_speed[i] = json_object_get_double(json_object_array_get_idx(wind_speed_array, i));
-            precipitation[i] = json_object_get_int(json_object_array_get_idx(precipitation_probability_array, i));
-            cloud_cover[i] = json_object_get_int(json_object_array_get_idx(cloud_cover_array, i));
+            if (cache->size == cache->capacity)
+            {
+                int capacity = cache->capacity ? cache->capacity * 2 : FORECAST_CACHE_START_CAPACITY;
+                struct ForecastCacheEntry *entries = realloc(cache->entries, capacity * sizeof *entries);
+                if (!entries)
+                {
+                    perror("realloc()");
+                    return -1;
+                }
+                cache->entries = entries;
+                cache->capacity = capacity;
+            }
+            memmove(&cache->entries[idx + 1], &cache->entries[idx], (cache->size - idx) * sizeof *cache->entries);
+            ++cache->size;
         }
 
-        json_object_put(root);
-    }
-    else
-    {
-        (void)fprintf(stderr, "get_forecast(): error parsing JSON\n");
-        return -1;
+        entry = &cache->entries[idx];
+        entry->location = location;
+        entry->expires = now + cache->ttl;
+        memcpy(entry->forecasts, fetched, sizeof fetched);
+
+        first = (long)((now - entry->forecasts[0].start) / SECONDS_PER_DAY);
+        // a clock a bit off the upstream one must not index outside the window
+        if (first < 0)
+        {
+            first = 0;
+        }
+        if (first + days > FORECAST_CACHE_DAYS)
+        {
+            (void)fprintf(stderr, "forecast_cache_get(): fetched forecast doesn't cover requested days\n");
+            return -1;
+        }
     }
 
+    memcpy(forecasts, &entry->forecasts[first], days * sizeof *forecasts);
     return 0;
 }
+
+void forecast_cache_evict(struct ForecastCache *cache, time_t now)
+{
+    int kept = 0;
+    for (int i = 0; i < cache->size; ++i)
+    {
+        // expired entries stay for another ttl as a fallback when upstream is down
+        if (now < cache->entries[i].expires + cache->ttl)
+        {
+            cache->entries[kept++] = cache->entries[i];
+        }
+    }
+    cache->size = kept;
+}
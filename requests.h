@@ -2,12 +2,91 @@
 #define REQUESTS_H
 
 #include <curl/curl.h>
+#include <json-c/json.h>
+#include <stddef.h>
+#include <time.h>
 
-#ifdef UNIT_TEST
-int parse_ip_info(const char *json_string, double *latitude, double *longitude);
+#define HOURS 24
+#define SECONDS_PER_DAY 86400
+#define MAX_FORECAST_DAYS 7   // most days a single message covers
+#define MAX_UPSTREAM_DAYS 16  // most days open-meteo forecasts
+#define REQUEST_URL_LENGTH 250
+#define REQUEST_RESPONSE_LENGTH 32768
+#define FORECAST_CACHE_TTL (3 * SECONDS_PER_DAY)
+// days the cache fetches at once, enough for MAX_FORECAST_DAYS on every day until the entry expires
+#define FORECAST_CACHE_DAYS (MAX_FORECAST_DAYS + FORECAST_CACHE_TTL / SECONDS_PER_DAY)
+#define FORECAST_CACHE_START_CAPACITY 16
+
+_Static_assert(FORECAST_CACHE_DAYS <= MAX_UPSTREAM_DAYS, "cache window is longer than open-meteo forecasts");
+
+struct Location
+{
+    double latitude;
+    double longitude;
+};
+
+// One day at the forecast location, hour 0 is local midnight
+struct Forecast
+{
+    time_t start; // UTC time of local midnight
+    double temperature[HOURS];
+    int humidity[HOURS];
+    double wind_speed[HOURS];
+    int precipitation[HOURS];
+    int cloud_cover[HOURS];
+};
+
+// Everything a request needs, owned by the caller. One context per thread,
+// requests made through different contexts don't share any state.
+struct RequestContext
+{
+    CURL *curl;
+    struct json_tokener *tokener;
+    char url[REQUEST_URL_LENGTH];
+    char response[REQUEST_RESPONSE_LENGTH];
+    size_t response_len;
+};
+
+int request_context_init(struct RequestContext *ctx);
+void request_context_cleanup(struct RequestContext *ctx);
+
+#if defined(UNIT_TEST) || defined(MICROBENCH)
+int parse_ip_info(struct RequestContext *ctx, const char *json_string, size_t len, struct Location *location);
+int parse_forecast(struct RequestContext *ctx, const char *json_string, size_t len, int days,
+                   struct Forecast *forecasts);
 #endif
 
-int get_geolocation(CURL *curl, const char *ip_address, double *latitude, double *longitude);
-int get_forecast(CURL *curl, double latitude, double longitude, double *temperature, int *humidity, double *wind_speed,
-                 int *precipitation, int *cloud_cover, int len);
+int get_geolocation(struct RequestContext *ctx, const char *ip_address, struct Location *location);
+// Orders by latitude, then longitude
+int compare_locations(const struct Location *lhs, const struct Location *rhs);
+// Fetches days (up to MAX_UPSTREAM_DAYS) consecutive days starting today at the location into forecasts
+int get_forecast(struct RequestContext *ctx, struct Location location, int days, struct Forecast *forecasts);
+
+struct ForecastCacheEntry
+{
+    struct Location location;
+    time_t expires;
+    struct Forecast forecasts[FORECAST_CACHE_DAYS];
+};
+
+// Per location store of multi-day forecasts, so a location is fetched once every ttl
+// instead of once a day. Not thread-safe, each thread keeps its own.
+struct ForecastCache
+{
+    struct ForecastCacheEntry *entries; // sorted by location
+    int size;
+    int capacity;
+    time_t ttl;
+    long fetches; // upstream requests made so far
+};
+
+void forecast_cache_init(struct ForecastCache *cache, time_t ttl);
+void forecast_cache_free(struct ForecastCache *cache);
+// Copies days consecutive days, starting with the one that contains now at the location,
+// fetching them first if the cached window expired or doesn't cover them. If that fetch
+// fails an expired window is served as long as it covers the days.
+int forecast_cache_get(struct ForecastCache *cache, struct RequestContext *ctx, struct Location location, time_t now,
+                       int days, struct Forecast *forecasts);
+// Drops entries expired for longer than ttl, e.g. of locations nobody is subscribed from anymore
+void forecast_cache_evict(struct ForecastCache *cache, time_t now);
 #endif // REQUESTS_H
@@ -1,12 +1,21 @@
+#include <arpa/inet.h>
 #include <check.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #define UNIT_TEST
 
+#include "delivery.h"
+#include "render.h"
 #include "requests.h"
 
-#define HOURS 24
-
 START_TEST(test_parse_ip_info)
 {
     const char *jsonString1 = "{ \"ip\": \"127.0.0.1\",\n"
@@ -21,62 +30,339 @@ START_TEST(test_parse_ip_info)
                               "\"timezone\": \"Asia/Shanghai\",\n"
                               "\"readme\": \"https://ipinfo.io/missingauth\"\n"
                               "}";
-    double latitude = 0.;
-    double longitude = 0.;
+    struct RequestContext ctx;
+    ck_assert_int_eq(request_context_init(&ctx), 0);
+
+    struct Location location = {0., 0.};
     int rc;
 
-    rc = parse_ip_info(jsonString1, &latitude, &longitude);
+    rc = parse_ip_info(&ctx, jsonString1, strlen(jsonString1), &location);
     ck_assert_int_eq(rc, -1);
-    ck_assert_double_eq_tol(latitude, 0., 0.0001);
-    ck_assert_double_eq_tol(longitude, 0., 0.0001);
+    ck_assert_double_eq_tol(location.latitude, 0., 0.0001);
+    ck_assert_double_eq_tol(location.longitude, 0., 0.0001);
 
-    rc = parse_ip_info(jsonString2, &latitude, &longitude);
+    rc = parse_ip_info(&ctx, jsonString2, strlen(jsonString2), &location);
     ck_assert_int_eq(rc, 0);
-    ck_assert_double_eq_tol(latitude, 34.7578, 0.0001);
-    ck_assert_double_eq_tol(longitude, 113.6486, 0.0001);
+    ck_assert_double_eq_tol(location.latitude, 34.7578, 0.0001);
+    ck_assert_double_eq_tol(location.longitude, 113.6486, 0.0001);
+
+    request_context_cleanup(&ctx);
 }
 END_TEST
 
 START_TEST(test_get_geolocation)
 {
-    CURL *curl = curl_easy_init();
-    ck_assert_ptr_nonnull(curl);
+    struct RequestContext ctx;
+    ck_assert_int_eq(request_context_init(&ctx), 0);
 
     const char *ip1 = "127.0.0.1";
     const char *ip2 = "123.12.0.42";
 
-    double latitude = 0.;
-    double longitude = 0.;
+    struct Location location = {0., 0.};
     int rc;
 
-    rc = get_geolocation(curl, ip1, &latitude, &longitude);
+    rc = get_geolocation(&ctx, ip1, &location);
     ck_assert_int_eq(rc, -1);
-    ck_assert_double_eq_tol(latitude, 0., 0.0001);
-    ck_assert_double_eq_tol(longitude, 0., 0.0001);
+    ck_assert_double_eq_tol(location.latitude, 0., 0.0001);
+    ck_assert_double_eq_tol(location.longitude, 0., 0.0001);
 
-    rc = get_geolocation(curl, ip2, &latitude, &longitude);
+    rc = get_geolocation(&ctx, ip2, &location);
     ck_assert_int_eq(rc, 0);
-    ck_assert_double_eq_tol(latitude, 34.7578, 0.0001);
-    ck_assert_double_eq_tol(longitude, 113.6486, 0.0001);
+    ck_assert_double_eq_tol(location.latitude, 34.7578, 0.0001);
+    ck_assert_double_eq_tol(location.longitude, 113.6486, 0.0001);
 
-    curl_easy_cleanup(curl);
+    request_context_cleanup(&ctx);
+}
+END_TEST
+
+// Builds an open-meteo like response starting 2024-01-01 00:00 UTC+2 where every value is its hour index
+static int make_forecast_json(char *buf, int size, int hours)
+{
+    static const char *fields[] = {"time", "temperature_2m", "relative_humidity_2m", "precipitation_probability",
+                                   "cloud_cover", "wind_speed_10m"};
+    int len = snprintf(buf, size, "{\"latitude\":34.75,\"longitude\":113.625,\"utc_offset_seconds\":7200,\"hourly\":{");
+    for (int f = 0; f < 6; ++f)
+    {
+        len += snprintf(buf + len, size - len, "%s\"%s\":[", f == 0 ? "" : ",", fields[f]);
+        for (int i = 0; i < hours; ++i)
+        {
+            if (f == 0)
+            {
+                len += snprintf(buf + len, size - len, "%s\"2024-01-%02dT%02d:00\"", i == 0 ? "" : ",", 1 + i / HOURS,
+                                i % HOURS);
+            }
+            else
+            {
+                len += snprintf(buf + len, size - len, "%s%d", i == 0 ? "" : ",", i);
+            }
+        }
+        len += snprintf(buf + len, size - len, "]");
+    }
+    len += snprintf(buf + len, size - len, "}}");
+    return len;
+}
+
+START_TEST(test_parse_forecast)
+{
+    struct RequestContext ctx;
+    ck_assert_int_eq(request_context_init(&ctx), 0);
+
+    char json[REQUEST_RESPONSE_LENGTH];
+    struct Forecast forecasts[2];
+    int rc;
+
+    int len = make_forecast_json(json, sizeof json, HOURS - 1);
+    rc = parse_forecast(&ctx, json, len, 1, forecasts);
+    ck_assert_int_eq(rc, -1);
+
+    len = make_forecast_json(json, sizeof json, HOURS);
+    rc = parse_forecast(&ctx, json, len, 1, forecasts);
+    ck_assert_int_eq(rc, 0);
+    for (int i = 0; i < HOURS; ++i)
+    {
+        ck_assert_double_eq_tol(forecasts[0].temperature[i], i, 0.0001);
+        ck_assert_int_eq(forecasts[0].humidity[i], i);
+        ck_assert_double_eq_tol(forecasts[0].wind_speed[i], i, 0.0001);
+        ck_assert_int_eq(forecasts[0].precipitation[i], i);
+        ck_assert_int_eq(forecasts[0].cloud_cover[i], i);
+    }
+
+    // 2024-01-01T00:00 at UTC+2
+    const time_t start = 1704067200 - 7200;
+    len = make_forecast_json(json, sizeof json, 2 * HOURS);
+    rc = parse_forecast(&ctx, json, len, 1, forecasts);
+    ck_assert_int_eq(rc, -1);
+    rc = parse_forecast(&ctx, json, len, 2, forecasts);
+    ck_assert_int_eq(rc, 0);
+    ck_assert_int_eq(forecasts[0].start, start);
+    ck_assert_int_eq(forecasts[1].start, start + SECONDS_PER_DAY);
+    ck_assert_double_eq_tol(forecasts[1].temperature[0], HOURS, 0.0001);
+    ck_assert_int_eq(forecasts[1].cloud_cover[HOURS - 1], 2 * HOURS - 1);
+
+    rc = parse_forecast(&ctx, "{\"hourly\":", 10, 1, forecasts);
+    ck_assert_int_eq(rc, -1);
+
+    request_context_cleanup(&ctx);
 }
 END_TEST
 
 START_TEST(test_get_forecast)
 {
-    CURL *curl = curl_easy_init();
-    ck_assert_ptr_nonnull(curl);
-
-    double temperature[HOURS];
-    int humidity[HOURS];
-    double wind_speed[HOURS];
-    int precipitation[HOURS];
-    int cloud_cover[HOURS];
-    int rc =
-        get_forecast(curl, 34.7578, 113.6486, temperature, humidity, wind_speed, precipitation, cloud_cover, HOURS);
+    struct RequestContext ctx;
+    ck_assert_int_eq(request_context_init(&ctx), 0);
+
+    struct Location location = {34.7578, 113.6486};
+    struct Forecast forecasts[MAX_FORECAST_DAYS];
+    int rc = get_forecast(&ctx, location, 1, forecasts);
+    ck_assert_int_eq(rc, 0);
+
+    rc = get_forecast(&ctx, location, MAX_FORECAST_DAYS, forecasts);
+    ck_assert_int_eq(rc, 0);
+    ck_assert_int_eq(forecasts[1].start - forecasts[0].start, SECONDS_PER_DAY);
+
+    struct Forecast upstream[MAX_UPSTREAM_DAYS + 1];
+    rc = get_forecast(&ctx, location, MAX_UPSTREAM_DAYS + 1, upstream);
+    ck_assert_int_eq(rc, -1);
+
+    request_context_cleanup(&ctx);
+}
+END_TEST
+
+START_TEST(test_forecast_cache)
+{
+    struct RequestContext ctx;
+    ck_assert_int_eq(request_context_init(&ctx), 0);
+    struct ForecastCache cache;
+    forecast_cache_init(&cache, FORECAST_CACHE_TTL);
+
+    struct Location location = {34.7578, 113.6486};
+    struct Forecast today;
+    struct Forecast tomorrow[2];
+    time_t now = time(NULL);
+    int rc;
+
+    rc = forecast_cache_get(&cache, &ctx, location, now, 1, &today);
     ck_assert_int_eq(rc, 0);
-    curl_easy_cleanup(curl);
+    ck_assert_int_eq(cache.fetches, 1);
+
+    // next day is served from the same fetch
+    rc = forecast_cache_get(&cache, &ctx, location, now + SECONDS_PER_DAY, 2, tomorrow);
+    ck_assert_int_eq(rc, 0);
+    ck_assert_int_eq(cache.fetches, 1);
+    ck_assert_int_eq(tomorrow[0].start, today.start + SECONDS_PER_DAY);
+
+    // the longest message is still served from the same fetch right before it expires
+    struct Forecast week[MAX_FORECAST_DAYS];
+    rc = forecast_cache_get(&cache, &ctx, location, now + FORECAST_CACHE_TTL - 1, MAX_FORECAST_DAYS, week);
+    ck_assert_int_eq(rc, 0);
+    ck_assert_int_eq(cache.fetches, 1);
+
+    // expired entries are fetched again
+    rc = forecast_cache_get(&cache, &ctx, location, now + FORECAST_CACHE_TTL, 1, &today);
+    ck_assert_int_eq(rc, 0);
+    ck_assert_int_eq(cache.fetches, 2);
+
+    forecast_cache_evict(&cache, now + 2 * FORECAST_CACHE_TTL + 1);
+    ck_assert_int_eq(cache.size, 1);
+    forecast_cache_evict(&cache, now + 3 * FORECAST_CACHE_TTL + 1);
+    ck_assert_int_eq(cache.size, 0);
+
+    forecast_cache_free(&cache);
+    request_context_cleanup(&ctx);
+}
+END_TEST
+
+START_TEST(test_render_forecast)
+{
+    struct Forecast forecast;
+    for (int i = 0; i < HOURS; ++i)
+    {
+        forecast.temperature[i] = -3.7;
+        forecast.humidity[i] = 81;
+        forecast.wind_speed[i] = 12.34;
+        forecast.precipitation[i] = 50;
+        forecast.cloud_cover[i] = 10;
+    }
+
+    char buf[PAYLOAD_LEN];
+    int len = render_forecast(buf, sizeof buf, "Monday", &forecast);
+    ck_assert_int_eq(len, (int)strlen(buf));
+    ck_assert_str_eq(strtok(buf, "\n"), "Forecast for Monday:");
+    ck_assert_str_eq(strtok(NULL, "\n"),
+                     "00:00: Temperature -3C, Humididty 81%, Wind 12.3km/h, Likely will be snow or rain, Clear sky");
+
+    // output is cut but stays terminated when the buffer is too small
+    len = render_forecast(buf, 64, "Monday", &forecast);
+    ck_assert_int_eq(len, 63);
+    ck_assert_int_eq(len, (int)strlen(buf));
+}
+END_TEST
+
+struct SlowReader
+{
+    int socket;
+    char *buf;
+    size_t len;
+    size_t received;
+};
+
+// Reads in small chunks with a pause in between, so the sender's socket buffer fills up
+static void *slow_reader_thread(void *arg)
+{
+    struct SlowReader *reader = arg;
+    struct timespec pause = {.tv_nsec = 1000000};
+    while (reader->received < reader->len)
+    {
+        size_t chunk = reader->len - reader->received < 4096 ? reader->len - reader->received : 4096;
+        ssize_t n = recv(reader->socket, reader->buf + reader->received, chunk, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        reader->received += (size_t)n;
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+START_TEST(test_delivery_slow_reader)
+{
+    const size_t len = 1 << 20;
+    struct Delivery *delivery = delivery_create();
+    ck_assert_ptr_nonnull(delivery);
+    char *arena = delivery_arena(delivery, len);
+    ck_assert_ptr_nonnull(arena);
+    for (size_t i = 0; i < len; ++i)
+    {
+        arena[i] = (char)('a' + i % 26);
+    }
+
+    int sv[2];
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    struct SlowReader reader = {.socket = sv[1], .buf = malloc(len), .len = len};
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, slow_reader_thread, &reader), 0);
+
+    struct Payload payload = {arena, len};
+    struct Target target = {sv[0], 0};
+    ck_assert_int_eq(delivery_broadcast(delivery, &payload, &target, 1), 0);
+
+    pthread_join(thread, NULL);
+    ck_assert_uint_eq(reader.received, len);
+    ck_assert_int_eq(memcmp(reader.buf, arena, len), 0);
+
+    delivery_destroy(delivery);
+    close(sv[0]);
+    close(sv[1]);
+    free(reader.buf);
+}
+END_TEST
+
+START_TEST(test_delivery_closed_peer)
+{
+    // required by delivery_broadcast(), registered buffer writes to a closed socket raise it
+    signal(SIGPIPE, SIG_IGN);
+
+    struct Delivery *delivery = delivery_create();
+    ck_assert_ptr_nonnull(delivery);
+    char *arena = delivery_arena(delivery, sizeof "forecast");
+    ck_assert_ptr_nonnull(arena);
+    strcpy(arena, "forecast");
+    struct Payload payload = {arena, strlen(arena)};
+    int open_sv[2];
+    int closed_sv[2];
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, open_sv), 0);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, closed_sv), 0);
+    close(closed_sv[1]);
+
+    struct Target targets[] = {{open_sv[0], 0}, {closed_sv[0], 0}};
+    ck_assert_int_eq(delivery_broadcast(delivery, &payload, targets, 2), 1);
+
+    char buf[sizeof "forecast"] = {0};
+    ck_assert_int_eq(recv(open_sv[1], buf, sizeof buf, 0), (ssize_t)payload.len);
+    ck_assert_str_eq(buf, "forecast");
+
+    delivery_destroy(delivery);
+    close(open_sv[0]);
+    close(open_sv[1]);
+    close(closed_sv[0]);
+}
+END_TEST
+
+START_TEST(test_listener)
+{
+    int serv_sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof addr;
+    ck_assert_int_eq(bind(serv_sock, (struct sockaddr *)&addr, sizeof addr), 0);
+    ck_assert_int_eq(listen(serv_sock, 1), 0);
+    ck_assert_int_eq(getsockname(serv_sock, (struct sockaddr *)&addr, &addr_len), 0);
+
+    struct Listener *listener = listener_create(serv_sock);
+    ck_assert_ptr_nonnull(listener);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_eq(connect(client, (struct sockaddr *)&addr, sizeof addr), 0);
+
+    struct ListenerEvent event;
+    ck_assert_int_eq(listener_wait(listener, &event, 1), 1);
+    ck_assert_int_eq(event.type, LISTENER_ACCEPT);
+    int accepted = event.fd;
+    ck_assert_int_eq(listener_watch(listener, accepted), 0);
+
+    close(client);
+    ck_assert_int_eq(listener_wait(listener, &event, 1), 1);
+    ck_assert_int_eq(event.type, LISTENER_HANGUP);
+    ck_assert_int_eq(event.fd, accepted);
+
+    ck_assert_int_eq(listener_wake(listener), 0);
+    ck_assert_int_eq(listener_wait(listener, &event, 1), 1);
+    ck_assert_int_eq(event.type, LISTENER_WAKEUP);
+
+    listener_unwatch(listener, accepted);
+    listener_destroy(listener);
+    close(accepted);
+    close(serv_sock);
 }
 END_TEST
 
@@ -87,7 +373,13 @@ Suite *add_suite()
 
     tcase_add_test(tc_core, test_parse_ip_info);
     tcase_add_test(tc_core, test_get_geolocation);
+    tcase_add_test(tc_core, test_parse_forecast);
     tcase_add_test(tc_core, test_get_forecast);
+    tcase_add_test(tc_core, test_forecast_cache);
+    tcase_add_test(tc_core, test_render_forecast);
+    tcase_add_test(tc_core, test_delivery_slow_reader);
+    tcase_add_test(tc_core, test_delivery_closed_peer);
+    tcase_add_test(tc_core, test_listener);
     suite_add_tcase(s, tc_core);
 
     return s;